@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include "simple_xml.h"
+#include "simple_vector.h"
+#include "test_fixture.h"
+
+#define ITERATIONS 200000
+
+typedef struct Programmer {
+  XMLStringSlice name;
+  XMLStringSlice languages[16];
+  int language_count;
+} Programmer;
+
+static XMLBinding programmer_bindings[] = {
+  { "programmer/name", XML_BIND_STRING, offsetof(Programmer, name), 0, 0 },
+  { "programmer/languages/language", XML_BIND_STRING, 
+    offsetof(Programmer, languages), 16, offsetof(Programmer, language_count) },
+};
+
+// Return current time in seconds
+static double now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Release tree `e` and all its children
+static void release_tree(XMLElement *e) {
+  int i;
+  for (i = 0; i < vector_size(e->children); ++i)
+    release_tree(vector_get_element_at(e->children, i));
+  XMLElement_release(e);
+}
+
+// Parse a tree then walk it to fill `p`, the way callers did before binding
+// Slices of `p` point into the returned tree, release it after use
+static XMLElement* parse_then_walk(char *text, Programmer *p) {
+  XMLElement *root;
+  int i, j;
+
+  root = parse_xml_from_text(text);
+  p->language_count = 0;
+  for (i = 0; i < vector_size(root->children); ++i) {
+    XMLElement *child = vector_get_element_at(root->children, i);
+    if (strcmp(child->tag_name, "name") == 0) {
+      p->name.data = child->value;
+      p->name.length = strlen(child->value);
+    } else if (strcmp(child->tag_name, "languages") == 0) {
+      for (j = 0; j < vector_size(child->children) && j < 16; ++j) {
+        XMLElement *language = vector_get_element_at(child->children, j);
+        p->languages[j].data = language->value;
+        p->languages[j].length = strlen(language->value);
+        p->language_count++;
+      }
+    }
+  }
+  return root;
+}
+
+#define PROGRAMMERS 2000
+#define PARSE_ITERATIONS 50
+
+// Return document with PROGRAMMERS programmers, indented like real files
+// Names are Vietnamese so the UTF-8 validator sees multi-byte sequences
+static char* programmers_xml() {
+  char *s, *pos;
+  int i;
+
+  s = malloc(PROGRAMMERS * 400 + 100);
+  pos = s + sprintf(s, "<?xml version=\"1.0\"?>\n<programmers>\n");
+  for (i = 0; i < PROGRAMMERS; ++i) {
+    pos += sprintf(pos, 
+        "  <!-- programmer %d -->\n"
+        "  <programmer>\n"
+        "    <name>L\xC3\xAA Nguy\xE1\xBB\x85n %d</name>\n"
+        "    <languages>\n"
+        "      <language>C</language>\n"
+        "      <language>Python</language>\n"
+        "      <language>Objective C</language>\n"
+        "      <language><![CDATA[C++]]></language>\n"
+        "    </languages>\n"
+        "  </programmer>\n", i, i);
+  }
+  sprintf(pos, "</programmers>\n");
+  return s;
+}
+
+// Benchmark parse_xml_from_text on the corpus
+static void bench_parse() {
+  char *corpus;
+  double start, elapsed;
+  int i, size;
+
+  corpus = programmers_xml();
+  size = strlen(corpus);
+  start = now();
+  for (i = 0; i < PARSE_ITERATIONS; ++i)
+    release_tree(parse_xml_from_text(corpus));
+  elapsed = now() - start;
+
+  printf("parse corpus %d bytes x %d\n", size, PARSE_ITERATIONS);
+  printf("  parse            %8.1f MB/s\n", size / (elapsed / PARSE_ITERATIONS) / 1e6);
+  free(corpus);
+}
+
+// Benchmark parse_xml_from_buffer on the corpus with and without strict
+// UTF-8 validation, runs alternate so both see the same machine load
+static void bench_strict_utf8() {
+  char *corpus;
+  double start, relaxed, strict;
+  int i, size, offset;
+
+  corpus = programmers_xml();
+  size = strlen(corpus);
+  relaxed = strict = 0;
+  for (i = 0; i < PARSE_ITERATIONS; ++i) {
+    start = now();
+    release_tree(parse_xml_from_buffer(corpus, size, 0, &offset));
+    relaxed += now() - start;
+
+    start = now();
+    release_tree(parse_xml_from_buffer(corpus, size, 1, &offset));
+    strict += now() - start;
+  }
+
+  printf("parse_xml_from_buffer corpus %d bytes x %d\n", size, PARSE_ITERATIONS);
+  printf("  not strict       %8.1f MB/s\n", size / (relaxed / PARSE_ITERATIONS) / 1e6);
+  printf("  strict utf8      %8.1f MB/s  (%+.1f%%)\n", 
+      size / (strict / PARSE_ITERATIONS) / 1e6, (strict / relaxed - 1) * 100);
+  free(corpus);
+}
+
+int main(int argc, char** argv) {
+  Programmer p;
+  double start, walk, bind;
+  int i, checksum;
+
+  bench_parse();
+  bench_strict_utf8();
+
+  checksum = 0;
+  start = now();
+  for (i = 0; i < ITERATIONS; ++i) {
+    XMLElement *root = parse_then_walk(programmer_xml, &p);
+    checksum += p.language_count;
+    release_tree(root);
+  }
+  walk = now() - start;
+
+  start = now();
+  for (i = 0; i < ITERATIONS; ++i) {
+    xml_bind_from_text(programmer_xml, programmer_bindings, 2, &p);
+    checksum -= p.language_count;
+  }
+  bind = now() - start;
+
+  printf("programmer/languages x %d (checksum %d)\n", ITERATIONS, checksum);
+  printf("  parse then walk  %8.1f ns/doc\n", walk / ITERATIONS * 1e9);
+  printf("  bind             %8.1f ns/doc  (%.1fx)\n", bind / ITERATIONS * 1e9, walk / bind);
+  return 0;
+}
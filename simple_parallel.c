@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <assert.h>
+#include <pthread.h>
+#include "simple_vector.h"
+#include "simple_xml.h"
+#include "simple_parallel.h"
+
+// Number of subtrees prepared per thread, more subtrees give better
+// balance when the tree is lopsided
+#define SUBTREES_PER_THREAD 4
+
+// One xml_parallel_for_each call, fields are guarded by the pool lock
+typedef struct ParallelJob {
+  Vector* subtrees;
+  int _next;
+  int _finished;
+  void (*fn)(XMLElement *e, void *arg);
+  void* arg;
+} ParallelJob;
+
+// Call `fn` for every element of subtree `e`
+static void parallel_visit(ParallelJob *job, XMLElement *e) {
+  Vector *stack;
+
+  stack = vector_create(stack);
+  vector_push_back(stack, e);
+  while (vector_size(stack) > 0) {
+    XMLElement *top = vector_pop_back(stack);
+    int i;
+
+    job->fn(top, job->arg);
+    for (i = vector_size(top->children) - 1; i >= 0; --i)
+      vector_push_back(stack, vector_get_element_at(top->children, i));
+  }
+  vector_release(stack);
+}
+
+// Take next subtree of `job`, pool lock must be held
+// A job is removed from the queue when its last subtree is taken
+// Return index of subtree, or -1 if none is left
+static int parallel_take(XMLThreadPool *pool, ParallelJob *job) {
+  int index;
+
+  if (job->_next >= vector_size(job->subtrees))
+    return -1;
+  index = job->_next++;
+  if (job->_next == vector_size(job->subtrees))
+    vector_remove_element_at_index(pool->_jobs, vector_index_of(pool->_jobs, job));
+  return index;
+}
+
+// Visit subtree `index` of `job` with pool lock released, then count it
+// Pool lock must be held
+static void parallel_run(XMLThreadPool *pool, ParallelJob *job, int index) {
+  pthread_mutex_unlock(&pool->_lock);
+  parallel_visit(job, vector_get_element_at(job->subtrees, index));
+  pthread_mutex_lock(&pool->_lock);
+
+  job->_finished++;
+  if (job->_finished == vector_size(job->subtrees))
+    pthread_cond_broadcast(&pool->_done);
+}
+
+// Worker thread body: take subtrees of queued jobs until pool stops
+static void* parallel_worker(void *data) {
+  XMLThreadPool *pool = data;
+
+  pthread_mutex_lock(&pool->_lock);
+  while (1) {
+    ParallelJob *job;
+
+    while (!pool->_stop && vector_size(pool->_jobs) == 0)
+      pthread_cond_wait(&pool->_work, &pool->_lock);
+    if (vector_size(pool->_jobs) == 0)
+      break;
+
+    job = vector_top_front(pool->_jobs);
+    parallel_run(pool, job, parallel_take(pool, job));
+  }
+  pthread_mutex_unlock(&pool->_lock);
+
+  return NULL;
+}
+
+// Initialize a pool of `threads` worker threads
+XMLThreadPool* XMLThreadPool_create(XMLThreadPool *pool, int threads) {
+  int i;
+
+  pool = malloc(sizeof(XMLThreadPool));
+  pool->_stop = 0;
+  pool->_jobs = vector_create(pool->_jobs);
+  pthread_mutex_init(&pool->_lock, NULL);
+  pthread_cond_init(&pool->_work, NULL);
+  pthread_cond_init(&pool->_done, NULL);
+
+  pool->_workers = malloc(sizeof(pthread_t) * (threads > 0 ? threads : 1));
+  pool->_threads = 0;
+  for (i = 0; i < threads; ++i) {
+    if (pthread_create(&pool->_workers[i], NULL, parallel_worker, pool) != 0)
+      break;
+    pool->_threads++;
+  }
+
+  return pool;
+}
+
+// Stop and join worker threads and release pool `pool`
+void XMLThreadPool_release(XMLThreadPool *pool) {
+  int i;
+
+  pthread_mutex_lock(&pool->_lock);
+  pool->_stop = 1;
+  pthread_cond_broadcast(&pool->_work);
+  pthread_mutex_unlock(&pool->_lock);
+  for (i = 0; i < pool->_threads; ++i)
+    pthread_join(pool->_workers[i], NULL);
+
+  pthread_cond_destroy(&pool->_done);
+  pthread_cond_destroy(&pool->_work);
+  pthread_mutex_destroy(&pool->_lock);
+  vector_release(pool->_jobs);
+  free(pool->_workers);
+  free(pool);
+  pool = NULL;
+}
+
+// Call `fn(e, arg)` once for every element `e` of tree `root`
+void xml_parallel_for_each(XMLElement *root, 
+    void (*fn)(XMLElement *e, void *arg), void *arg, XMLThreadPool *pool) {
+  ParallelJob job;
+  int i, index, threads;
+
+  assert(root != NULL && root->frozen && "tree must be frozen");
+
+  job.fn = fn;
+  job.arg = arg;
+  job._next = 0;
+  job._finished = 0;
+  job.subtrees = vector_create(job.subtrees);
+  vector_push_back(job.subtrees, root);
+
+  // split widest first: visit the top of the tree here and keep its
+  // children as subtrees until there are enough for every thread
+  threads = pool != NULL ? pool->_threads + 1 : 1;
+  if (threads > 1) {
+    while (vector_size(job.subtrees) > 0 
+        && vector_size(job.subtrees) < threads * SUBTREES_PER_THREAD) {
+      XMLElement *e = vector_pop_front(job.subtrees);
+      fn(e, arg);
+      for (i = 0; i < vector_size(e->children); ++i)
+        vector_push_back(job.subtrees, vector_get_element_at(e->children, i));
+    }
+  }
+
+  if (threads == 1) {
+    for (i = 0; i < vector_size(job.subtrees); ++i)
+      parallel_visit(&job, vector_get_element_at(job.subtrees, i));
+  } else if (vector_size(job.subtrees) > 0) {
+    // queue job, then work on it here too until its subtrees are all taken
+    pthread_mutex_lock(&pool->_lock);
+    vector_push_back(pool->_jobs, &job);
+    pthread_cond_broadcast(&pool->_work);
+    while ((index = parallel_take(pool, &job)) >= 0)
+      parallel_run(pool, &job, index);
+    while (job._finished < vector_size(job.subtrees))
+      pthread_cond_wait(&pool->_done, &pool->_lock);
+    pthread_mutex_unlock(&pool->_lock);
+  }
+
+  vector_release(job.subtrees);
+}
@@ -0,0 +1,45 @@
+#ifndef SIMPLE_PARALLEL_H_
+#define SIMPLE_PARALLEL_H_
+
+#include <pthread.h>
+#include "simple_xml.h"
+
+// Pool of worker threads shared by all xml_parallel_for_each calls
+// Threads are created once, so a query pays no thread creation and many
+// concurrent callers share the same `threads` workers instead of each
+// starting their own
+typedef struct XMLThreadPool {
+  int _threads;
+  pthread_t* _workers;
+  pthread_mutex_t _lock;
+  pthread_cond_t _work;       // signaled when a job is added or pool stops
+  pthread_cond_t _done;       // signaled when a job is finished
+  struct Vector* _jobs;       // jobs with subtrees left to take
+  int _stop;
+} XMLThreadPool;
+
+// Initialize a pool of `threads` worker threads
+XMLThreadPool* XMLThreadPool_create(XMLThreadPool *pool, int threads);
+
+// Stop and join worker threads and release pool `pool`
+// No xml_parallel_for_each call may be running on `pool`
+void XMLThreadPool_release(XMLThreadPool *pool);
+
+// Call `fn(e, arg)` once for every element `e` of tree `root`, using
+// workers of `pool` and the calling thread
+// If `pool` is NULL every call is made on the calling thread
+// `root` must be frozen (see XMLElement_freeze)
+//
+// The tree is split into subtrees which threads take one at a time, so
+// `fn` is called concurrently and in no particular order; it must be
+// safe to call from many threads at once. Any number of threads may call
+// this function on the same pool at the same time
+//
+// Example
+//    >>> pool = XMLThreadPool_create(pool, 4);
+//    >>> XMLElement_freeze(root);
+//    >>> xml_parallel_for_each(root, count_languages, &counter, pool);
+void xml_parallel_for_each(XMLElement *root, 
+    void (*fn)(XMLElement *e, void *arg), void *arg, XMLThreadPool *pool);
+
+#endif
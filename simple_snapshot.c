@@ -0,0 +1,329 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "simple_vector.h"
+#include "simple_xml.h"
+#include "simple_snapshot.h"
+
+#define SNAPSHOT_HASH_SEED 2166136261u
+
+// FNV-1a hash of `size` bytes of `data`, continued from `hash`
+static uint32_t snapshot_hash(uint32_t hash, const char *data, size_t size) {
+  size_t i;
+  for (i = 0; i < size; ++i) {
+    hash ^= (unsigned char)data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+#define SNAPSHOT_CHECKSUM_PRIME 0x100000001B3ULL
+
+// Checksum of `size` bytes of `data`, continued from `checksum`
+// FNV-1a style but on 8 byte words, so verifying a large snapshot is
+// bound by memory bandwidth rather than by a multiply per byte
+static uint32_t snapshot_checksum(uint32_t checksum, const char *data, size_t size) {
+  uint64_t hash = 0xCBF29CE484222325ULL ^ checksum;
+  size_t i;
+
+  for (i = 0; i + 8 <= size; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * SNAPSHOT_CHECKSUM_PRIME;
+  }
+  for (; i < size; ++i)
+    hash = (hash ^ (unsigned char)data[i]) * SNAPSHOT_CHECKSUM_PRIME;
+
+  return (uint32_t)(hash ^ (hash >> 32));
+}
+
+// String table which stores every distinct string once
+// `_slots` is an open addressing hash set of offsets in `_data`
+typedef struct StringTable {
+  char* _data;
+  size_t _size;
+  size_t _capacity;
+  uint32_t* _slots;
+  size_t _slot_count;
+  size_t _slot_used;
+} StringTable;
+
+static StringTable* StringTable_create(StringTable *t) {
+  t = malloc(sizeof(StringTable));
+  t->_size = 0;
+  t->_capacity = 256;
+  t->_data = malloc(t->_capacity);
+  t->_slot_used = 0;
+  t->_slot_count = 64;
+  t->_slots = malloc(t->_slot_count * sizeof(uint32_t));
+  memset(t->_slots, 0xFF, t->_slot_count * sizeof(uint32_t));
+  return t;
+}
+
+static void StringTable_release(StringTable *t) {
+  free(t->_slots);
+  free(t->_data);
+  free(t);
+  t = NULL;
+}
+
+// Put offset `offset` of string in `_data` to a free slot
+static void string_table_put_slot(StringTable *t, uint32_t offset) {
+  const char *str = t->_data + offset;
+  size_t mask = t->_slot_count - 1;
+  size_t i = snapshot_hash(SNAPSHOT_HASH_SEED, str, strlen(str)) & mask;
+  while (t->_slots[i] != XML_SNAPSHOT_NONE)
+    i = (i + 1) & mask;
+  t->_slots[i] = offset;
+}
+
+// Return offset of `str` in string table `t`, add it if needed
+static uint32_t string_table_add(StringTable *t, const char *str) {
+  size_t size = strlen(str) + 1;
+  size_t mask = t->_slot_count - 1;
+  size_t i = snapshot_hash(SNAPSHOT_HASH_SEED, str, size - 1) & mask;
+  uint32_t offset;
+
+  while (t->_slots[i] != XML_SNAPSHOT_NONE) {
+    if (strcmp(t->_data + t->_slots[i], str) == 0)
+      return t->_slots[i];
+    i = (i + 1) & mask;
+  }
+
+  // append string
+  while (t->_size + size > t->_capacity) {
+    t->_capacity *= 2;
+    t->_data = realloc(t->_data, t->_capacity);
+  }
+  offset = t->_size;
+  memcpy(t->_data + offset, str, size);
+  t->_size += size;
+  t->_slots[i] = offset;
+  t->_slot_used++;
+
+  // keep load factor under 1/2
+  if (t->_slot_used * 2 > t->_slot_count) {
+    size_t k, old_count = t->_slot_count;
+    uint32_t *old_slots = t->_slots;
+    t->_slot_count *= 2;
+    t->_slots = malloc(t->_slot_count * sizeof(uint32_t));
+    memset(t->_slots, 0xFF, t->_slot_count * sizeof(uint32_t));
+    for (k = 0; k < old_count; ++k) {
+      if (old_slots[k] != XML_SNAPSHOT_NONE)
+        string_table_put_slot(t, old_slots[k]);
+    }
+    free(old_slots);
+  }
+
+  return offset;
+}
+
+// Write tree `root` to file `path`
+//
+// Return 1 if write sucessfull
+//        0 if have any errors (like cannot open file)
+int xml_snapshot_write(XMLElement *root, const char *path) {
+  XMLSnapshotHeader header;
+  XMLSnapshotNode *nodes;
+  StringTable *strings;
+  Vector *queue;
+  uint32_t hash;
+  int i, j, size, result;
+  FILE *f;
+
+  // breadth first order, children of queue[i] are appended together
+  queue = vector_create(queue);
+  vector_push_back(queue, root);
+  for (i = 0; i < vector_size(queue); ++i) {
+    XMLElement *e = vector_get_element_at(queue, i);
+    for (j = 0; j < vector_size(e->children); ++j)
+      vector_push_back(queue, vector_get_element_at(e->children, j));
+  }
+
+  size = vector_size(queue);
+  nodes = malloc(size * sizeof(XMLSnapshotNode));
+  strings = StringTable_create(strings);
+  nodes[0].parent = XML_SNAPSHOT_NONE;
+  for (i = 0, j = 1; i < size; ++i) {
+    XMLElement *e = vector_get_element_at(queue, i);
+    int k, count = vector_size(e->children);
+
+    nodes[i].tag_name = string_table_add(strings, e->tag_name != NULL ? e->tag_name : "");
+    nodes[i].value = e->value != NULL ? string_table_add(strings, e->value) : XML_SNAPSHOT_NONE;
+    nodes[i].first_child = j;
+    nodes[i].child_count = count;
+    for (k = 0; k < count; ++k)
+      nodes[j + k].parent = i;
+    j += count;
+  }
+  vector_release(queue);
+
+  memcpy(header.magic, XML_SNAPSHOT_MAGIC, 4);
+  header.version = XML_SNAPSHOT_VERSION;
+  header.node_count = size;
+  header.strings_offset = sizeof(XMLSnapshotHeader) + size * sizeof(XMLSnapshotNode);
+  header.strings_size = strings->_size;
+  // nodes then strings, the same two ranges xml_snapshot_verify reads
+  hash = snapshot_checksum(0, (const char *)nodes, size * sizeof(XMLSnapshotNode));
+  header.checksum = snapshot_checksum(hash, strings->_data, strings->_size);
+
+  result = 0;
+  f = fopen(path, "wb");
+  if (f != NULL) {
+    result = fwrite(&header, sizeof(header), 1, f) == 1
+      && fwrite(nodes, sizeof(XMLSnapshotNode), size, f) == (size_t)size
+      && fwrite(strings->_data, 1, strings->_size, f) == strings->_size;
+    if (fclose(f) != 0)
+      result = 0;
+  }
+
+  StringTable_release(strings);
+  free(nodes);
+  return result;
+}
+
+// Return 1 if header of mapped snapshot `data` matches its size
+// Only the header and last byte are read, so this costs no page faults
+// beyond the first and last page
+static int snapshot_validated(const char *data, size_t size) {
+  const XMLSnapshotHeader *header = (const XMLSnapshotHeader *)data;
+  uint32_t count;
+
+  if (size < sizeof(XMLSnapshotHeader)) return 0;
+  if (memcmp(header->magic, XML_SNAPSHOT_MAGIC, 4) != 0) return 0;
+  if (header->version != XML_SNAPSHOT_VERSION) return 0;
+
+  count = header->node_count;
+  if (count == 0 || count > (size - sizeof(XMLSnapshotHeader)) / sizeof(XMLSnapshotNode)) return 0;
+  if (header->strings_offset != sizeof(XMLSnapshotHeader) + count * sizeof(XMLSnapshotNode)) return 0;
+  if ((size_t)header->strings_offset + header->strings_size != size) return 0;
+  if (header->strings_size == 0 || data[size - 1] != '\0') return 0;
+
+  return 1;
+}
+
+// Map snapshot file `path` in memory
+// Return NULL if file cannot be mapped, or has wrong magic, version or
+// sizes
+XMLSnapshot* xml_snapshot_open(const char *path) {
+  XMLSnapshot *s;
+  struct stat st;
+  void *data;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  if (!snapshot_validated(data, st.st_size)) {
+    munmap(data, st.st_size);
+    return NULL;
+  }
+
+  s = malloc(sizeof(XMLSnapshot));
+  s->_data = data;
+  s->_size = st.st_size;
+  s->_node_count = ((const XMLSnapshotHeader *)data)->node_count;
+  s->_nodes = (const XMLSnapshotNode *)(s->_data + sizeof(XMLSnapshotHeader));
+  s->_strings = s->_data + ((const XMLSnapshotHeader *)data)->strings_offset;
+  return s;
+}
+
+// Unmap and release snapshot `s`
+void xml_snapshot_close(XMLSnapshot *s) {
+  munmap((void *)s->_data, s->_size);
+  free(s);
+  s = NULL;
+}
+
+// Check checksum and offsets of every node of snapshot `s`
+// Return 1 if snapshot is intact, 0 otherwise
+int xml_snapshot_verify(XMLSnapshot *s) {
+  const XMLSnapshotHeader *header = (const XMLSnapshotHeader *)s->_data;
+  uint32_t i, hash, count = s->_node_count;
+
+  hash = snapshot_checksum(0, (const char *)s->_nodes, count * sizeof(XMLSnapshotNode));
+  if (snapshot_checksum(hash, s->_strings, header->strings_size) != header->checksum) 
+    return 0;
+
+  for (i = 0; i < count; ++i) {
+    const XMLSnapshotNode *node = &s->_nodes[i];
+    if (node->tag_name >= header->strings_size) return 0;
+    if (node->value != XML_SNAPSHOT_NONE && node->value >= header->strings_size) return 0;
+    if (node->first_child > count || node->child_count > count - node->first_child) return 0;
+    if (i > 0 && node->parent >= count) return 0;
+  }
+
+  return 1;
+}
+
+// validate node index of snapshot `s`
+static void snapshot_node_validated(XMLSnapshot *s, int node) {
+  assert(s != NULL && "snapshot is NULL");
+  assert(node >= 0 && node < s->_node_count && "node of out range");
+}
+
+// Return number of nodes in snapshot `s`, root is node 0
+int xml_snapshot_size(XMLSnapshot *s) {
+  assert(s != NULL && "snapshot is NULL");
+  return s->_node_count;
+}
+
+// validate string offset of snapshot `s`
+// The string table ends with NUL (checked by open), so any offset inside
+// it gives a terminated string even in an unverified snapshot
+static const char* snapshot_string_at(XMLSnapshot *s, uint32_t offset) {
+  assert(offset < ((const XMLSnapshotHeader *)s->_data)->strings_size && "string of out range");
+  return s->_strings + offset;
+}
+
+// Return tag name of node `node`
+const char* xml_snapshot_tag_name(XMLSnapshot *s, int node) {
+  snapshot_node_validated(s, node);
+  return snapshot_string_at(s, s->_nodes[node].tag_name);
+}
+
+// Return value of node `node`, or NULL if it has no value
+const char* xml_snapshot_value(XMLSnapshot *s, int node) {
+  snapshot_node_validated(s, node);
+  if (s->_nodes[node].value == XML_SNAPSHOT_NONE)
+    return NULL;
+  return snapshot_string_at(s, s->_nodes[node].value);
+}
+
+// Return parent of node `node`, or -1 for root
+int xml_snapshot_parent(XMLSnapshot *s, int node) {
+  snapshot_node_validated(s, node);
+  if (node == 0)
+    return -1;
+  assert(s->_nodes[node].parent < (uint32_t)s->_node_count && "parent of out range");
+  return s->_nodes[node].parent;
+}
+
+// Return number of children of node `node`
+int xml_snapshot_child_count(XMLSnapshot *s, int node) {
+  snapshot_node_validated(s, node);
+  return s->_nodes[node].child_count;
+}
+
+// Return child of node `node` at index `index`
+// index must be in range [0..`child_count`)
+int xml_snapshot_child_at(XMLSnapshot *s, int node, int index) {
+  snapshot_node_validated(s, node);
+  assert(index >= 0 && index < (int)s->_nodes[node].child_count && "index of out range");
+  assert(s->_nodes[node].first_child + index < (uint32_t)s->_node_count && "child of out range");
+  return s->_nodes[node].first_child + index;
+}
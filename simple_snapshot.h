@@ -0,0 +1,93 @@
+#ifndef SIMPLE_SNAPSHOT_H_
+#define SIMPLE_SNAPSHOT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "simple_xml.h"
+
+// Binary snapshot of a parsed XMLElement tree
+//
+// Layout (native byte order, every offset is relative to start of file)
+//    XMLSnapshotHeader
+//    XMLSnapshotNode[node_count]   breadth first, so children of a node
+//                                  are contiguous and root is node 0
+//    string table                  NUL terminated strings, deduplicated
+//
+// A snapshot is loaded with mmap and read in place: no parsing and no
+// allocation per node. Strings returned by the accessors point into the
+// mapping and stay valid until `xml_snapshot_close`
+//
+// Opening only checks the header, so it costs O(1) and pages are faulted
+// in as nodes are read. Checking the checksum and every node offset reads
+// the whole file; that is left to `xml_snapshot_verify` so callers pay it
+// only when they do not trust the file. Accessors assert that offsets are
+// in range, so an unverified corrupt file fails an assert rather than
+// reading outside the mapping
+#define XML_SNAPSHOT_MAGIC "SXML"
+#define XML_SNAPSHOT_VERSION 2
+#define XML_SNAPSHOT_NONE 0xFFFFFFFFu
+
+typedef struct XMLSnapshotHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t node_count;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+  uint32_t checksum;      // of nodes then string table, 8 byte words at a time
+} XMLSnapshotHeader;
+
+typedef struct XMLSnapshotNode {
+  uint32_t tag_name;      // offset in string table
+  uint32_t value;         // offset in string table or XML_SNAPSHOT_NONE
+  uint32_t parent;        // node index or XML_SNAPSHOT_NONE for root
+  uint32_t first_child;   // node index
+  uint32_t child_count;
+} XMLSnapshotNode;
+
+typedef struct XMLSnapshot {
+  const char* _data;
+  size_t _size;
+  const XMLSnapshotNode* _nodes;
+  const char* _strings;
+  int _node_count;
+} XMLSnapshot;
+
+// Write tree `root` to file `path`
+//
+// Return 1 if write sucessfull
+//        0 if have any errors (like cannot open file)
+int xml_snapshot_write(XMLElement *root, const char *path);
+
+// Map snapshot file `path` in memory
+// Return NULL if file cannot be mapped, or has wrong magic, version or
+// sizes
+XMLSnapshot* xml_snapshot_open(const char *path);
+
+// Check checksum and offsets of every node of snapshot `s`
+// This reads the whole file, about as fast as memory bandwidth allows
+// Return 1 if snapshot is intact, 0 otherwise
+int xml_snapshot_verify(XMLSnapshot *s);
+
+// Unmap and release snapshot `s`
+void xml_snapshot_close(XMLSnapshot *s);
+
+// Return number of nodes in snapshot `s`, root is node 0
+int xml_snapshot_size(XMLSnapshot *s);
+
+// Return tag name of node `node`
+const char* xml_snapshot_tag_name(XMLSnapshot *s, int node);
+
+// Return value of node `node`, or NULL if it has no value
+const char* xml_snapshot_value(XMLSnapshot *s, int node);
+
+// Return parent of node `node`, or -1 for root
+int xml_snapshot_parent(XMLSnapshot *s, int node);
+
+// Return number of children of node `node`
+int xml_snapshot_child_count(XMLSnapshot *s, int node);
+
+// Return child of node `node` at index `index`
+// index must be in range [0..`child_count`)
+int xml_snapshot_child_at(XMLSnapshot *s, int node, int index);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SIMPLE_STATS_H_
+#define SIMPLE_STATS_H_
+
+// Instrumentation macros for hot paths
+// They compile to nothing unless the library is built with -DSIMPLE_XML_STATS
+//
+// Example
+//    STATS_TIMER_BEGIN(timer);
+//    token = parser_get_next_token(parser);
+//    STATS_TIMER_END(xml_stats.tokenize_cycles, timer);
+//    STATS_ADD(xml_stats.tokens[token->type], 1);
+
+#ifdef SIMPLE_XML_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define stats_cycles() __rdtsc()
+#else
+#include <time.h>
+// No portable cycle counter, use nanoseconds instead
+static inline unsigned long long stats_cycles(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+#endif
+
+// Number of re-allocations and of element moves done by vectors on the
+// calling thread, defined in simple_vector.c
+extern __thread long vector_stats_grows;
+extern __thread long vector_stats_moves;
+
+#define STATS_ADD(counter, n) ((counter) += (n))
+#define STATS_MAX(counter, n) do { if ((n) > (counter)) (counter) = (n); } while (0)
+#define STATS_TIMER_BEGIN(timer) unsigned long long timer = stats_cycles()
+#define STATS_TIMER_END(counter, timer) ((counter) += stats_cycles() - (timer))
+
+#else
+
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_MAX(counter, n) ((void)0)
+#define STATS_TIMER_BEGIN(timer)
+#define STATS_TIMER_END(counter, timer) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "simple_utf8.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Return number of leading non-NUL ASCII bytes of `data`, checked 16 bytes
+// at a time
+// Markup and most text in xml documents are ASCII, so the validator spends
+// almost all of its time here instead of in the per-sequence checks
+static int utf8_ascii_prefix(const unsigned char *data, int length) {
+  int pos = 0;
+
+#ifdef __SSE2__
+  const __m128i zero = _mm_setzero_si128();
+  while (pos + 16 <= length) {
+    __m128i chunk = _mm_loadu_si128((const __m128i *)(data + pos));
+    if (_mm_movemask_epi8(_mm_or_si128(chunk, _mm_cmpeq_epi8(chunk, zero))) != 0)
+      break;
+    pos += 16;
+  }
+#else
+  while (pos + 8 <= length) {
+    uint64_t chunk;
+    memcpy(&chunk, data + pos, sizeof(chunk));
+    // a 0x00 byte borrows and sets its high bit in `chunk - 0x01..01`
+    if ((chunk | (chunk - 0x0101010101010101ULL)) & 0x8080808080808080ULL)
+      break;
+    pos += 8;
+  }
+#endif
+
+  while (pos < length && data[pos] != 0 && data[pos] < 0x80)
+    pos++;
+  return pos;
+}
+
+// Return byte offset of the first invalid UTF-8 sequence in `data`
+// of `length` bytes, or -1 if `data` is valid UTF-8
+int utf8_validate(const char *data, int length) {
+  const unsigned char *s = (const unsigned char *)data;
+  int pos = 0;
+
+  while (pos < length) {
+    unsigned char ch;
+    unsigned char lower = 0x80, upper = 0xBF;
+    int i, size;
+
+    pos += utf8_ascii_prefix(s + pos, length - pos);
+    if (pos >= length)
+      break;
+
+    // well-formed byte sequences, see Unicode table 3-7
+    ch = s[pos];
+    // a 0x00 byte (U+0000) is not allowed in xml and falls to the error
+    if (ch >= 0xC2 && ch <= 0xDF) {
+      size = 2;
+    } else if (ch >= 0xE0 && ch <= 0xEF) {
+      size = 3;
+      if (ch == 0xE0) lower = 0xA0;
+      if (ch == 0xED) upper = 0x9F;
+    } else if (ch >= 0xF0 && ch <= 0xF4) {
+      size = 4;
+      if (ch == 0xF0) lower = 0x90;
+      if (ch == 0xF4) upper = 0x8F;
+    } else {
+      return pos;
+    }
+
+    if (pos + size > length)
+      return pos;
+    if (s[pos + 1] < lower || s[pos + 1] > upper)
+      return pos;
+    for (i = 2; i < size; ++i) {
+      if (s[pos + i] < 0x80 || s[pos + i] > 0xBF)
+        return pos;
+    }
+    pos += size;
+  }
+
+  return -1;
+}
+
+// Return code unit at byte offset `pos` of `data`
+static unsigned int utf16_unit_at(const unsigned char *data, int pos, int big_endian) {
+  if (big_endian)
+    return (data[pos] << 8) | data[pos + 1];
+  return data[pos] | (data[pos + 1] << 8);
+}
+
+// Transcode UTF-16 `data` of `length` bytes (without BOM) to UTF-8
+char* utf16_to_utf8(const char *data, int length, int big_endian, 
+    int *out_length, int *error_offset) {
+  const unsigned char *s = (const unsigned char *)data;
+  unsigned char *out;
+  int pos, size;
+
+  if (length % 2 != 0) {
+    if (error_offset != NULL) *error_offset = length - 1;
+    return NULL;
+  }
+
+  // each code unit takes at most 3 bytes, a surrogate pair (2 units) 4 bytes
+  out = malloc(length / 2 * 3 + 1);
+  size = 0;
+  pos = 0;
+  while (pos < length) {
+    unsigned int cp = utf16_unit_at(s, pos, big_endian);
+
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+      unsigned int low;
+      if (pos + 4 > length
+          || (low = utf16_unit_at(s, pos + 2, big_endian)) < 0xDC00
+          || low > 0xDFFF) {
+        free(out);
+        if (error_offset != NULL) *error_offset = pos;
+        return NULL;
+      }
+      cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+      pos += 4;
+    } else if ((cp >= 0xDC00 && cp <= 0xDFFF) || cp == 0) {
+      free(out);
+      if (error_offset != NULL) *error_offset = pos;
+      return NULL;
+    } else {
+      pos += 2;
+    }
+
+    if (cp < 0x80) {
+      out[size++] = cp;
+    } else if (cp < 0x800) {
+      out[size++] = 0xC0 | (cp >> 6);
+      out[size++] = 0x80 | (cp & 0x3F);
+    } else if (cp < 0x10000) {
+      out[size++] = 0xE0 | (cp >> 12);
+      out[size++] = 0x80 | ((cp >> 6) & 0x3F);
+      out[size++] = 0x80 | (cp & 0x3F);
+    } else {
+      out[size++] = 0xF0 | (cp >> 18);
+      out[size++] = 0x80 | ((cp >> 12) & 0x3F);
+      out[size++] = 0x80 | ((cp >> 6) & 0x3F);
+      out[size++] = 0x80 | (cp & 0x3F);
+    }
+  }
+  out[size] = '\0';
+  *out_length = size;
+
+  return (char *)out;
+}
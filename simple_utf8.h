@@ -0,0 +1,29 @@
+#ifndef SIMPLE_UTF8_H_
+#define SIMPLE_UTF8_H_
+
+// Return byte offset of the first invalid UTF-8 sequence in `data`
+// of `length` bytes, or -1 if `data` is valid UTF-8
+//
+// Overlong forms, surrogates (U+D800..U+DFFF), code points above U+10FFFF,
+// truncated sequences and U+0000 (not allowed in xml) are invalid
+//
+// Example
+//    >>> utf8_validate("Kien", 4)
+//    => -1
+//    >>> utf8_validate("Ki\xC0\xAFn", 5)
+//    => 2
+int utf8_validate(const char *data, int length);
+
+// Transcode UTF-16 `data` of `length` bytes (without BOM) to UTF-8
+// `big_endian` selects byte order of the code units
+// U+0000 is not allowed in xml and is reported as a bad code unit
+//
+// Return a newly allocated, NUL terminated UTF-8 string, you must free it,
+//        `out_length` is set to its length without the NUL
+//        NULL if `data` is not valid UTF-16 (odd length, unpaired
+//        surrogate or U+0000), `error_offset` (if not NULL) is set to the
+//        byte offset of the bad code unit in `data`
+char* utf16_to_utf8(const char *data, int length, int big_endian, 
+    int *out_length, int *error_offset);
+
+#endif
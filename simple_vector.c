@@ -1,6 +1,12 @@
 #include <stdlib.h>
 #include <assert.h>
 #include "simple_vector.h"
+#include "simple_stats.h"
+
+#ifdef SIMPLE_XML_STATS
+__thread long vector_stats_grows = 0;
+__thread long vector_stats_moves = 0;
+#endif
 
 // validate vector is not NULL
 static void vector_validated(Vector *v) {
@@ -115,14 +121,17 @@ int vector_insert_at_index(Vector *v, void* elem, int index) {
     for (i = 0; i < v->_size; ++i)
       v->_data[i] = old_data[i]; 
     free(old_data);
+    STATS_ADD(vector_stats_grows, 1);
+    STATS_ADD(vector_stats_moves, v->_size);
   }
 
   // insert element to vector
   v->_size++;
-  for (i = v->_size; i > index; --i) {
+  for (i = v->_size - 1; i > index; --i) {
     v->_data[i] = v->_data[i - 1];
   }
   v->_data[index] = elem;
+  STATS_ADD(vector_stats_moves, v->_size - 1 - index);
 
   return 1;
 }
@@ -136,10 +145,11 @@ void* vector_remove_element_at_index(Vector *v, int index) {
   int i; 
   void* elem;
   elem = v->_data[index];
-  for (i = index; i < v->_size; ++i) {
+  for (i = index; i < v->_size - 1; ++i) {
     v->_data[i] = v->_data[i + 1]; 
   }
   v->_size--;
+  STATS_ADD(vector_stats_moves, v->_size - index);
 
   return elem;
 }
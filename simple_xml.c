@@ -4,6 +4,12 @@
 #include <assert.h>
 #include "simple_vector.h"
 #include "simple_xml.h"
+#include "simple_utf8.h"
+#include "simple_stats.h"
+
+#ifdef SIMPLE_XML_STATS
+static __thread XMLParseStats xml_stats;
+#endif
 
 // Initialize for XMLElement `e` with `tag_name` and `value`
 // Example
@@ -16,6 +22,7 @@ XMLElement* XMLElement_create(XMLElement *e, char* tag_name, char* value) {
   e->value = value;
   e->parent = NULL;
   e->children = vector_create(e->children);
+  e->frozen = 0;
   return e;
 }
 
@@ -29,9 +36,58 @@ void XMLElement_release(XMLElement *e) {
   e = NULL;
 }
 
+// Freeze tree `root`, after that the tree must not be modified
+XMLElement* XMLElement_freeze(XMLElement *root) {
+  Vector *stack;
+
+  stack = vector_create(stack);
+  vector_push_back(stack, root);
+  while (vector_size(stack) > 0) {
+    XMLElement *e = vector_pop_back(stack);
+    int i;
+
+    for (i = 0; i < vector_size(e->children); ++i) {
+      XMLElement *child = vector_get_element_at(e->children, i);
+      child->parent = e;
+      vector_push_back(stack, child);
+    }
+    e->frozen = 1;
+  }
+  vector_release(stack);
+
+  return root;
+}
+
 #define BEGIN_TAG_TOKEN '<'
 #define END_TAG_TOKEN '>'
 #define SPLASH_TOKEN '/'
+#define QUESTION_TOKEN '?'
+#define EXCLAMATION_TOKEN '!'
+
+#define COMMENT_BEGIN "<!--"
+#define COMMENT_END "-->"
+#define PI_BEGIN "<?"
+#define PI_END "?>"
+#define CDATA_BEGIN "<![CDATA["
+#define CDATA_END "]]>"
+
+// Class of every input byte, scanner only branches on these classes
+// Order matters: classes from CLASS_BEGIN_TAG on end a text
+typedef enum {
+  CLASS_TEXT = 0,
+  CLASS_SPACE,
+  CLASS_BEGIN_TAG,
+  CLASS_END_TAG,
+} CharClass;
+
+static const unsigned char char_class[256] = {
+  [' '] = CLASS_SPACE,
+  ['\t'] = CLASS_SPACE,
+  ['\n'] = CLASS_SPACE,
+  ['\r'] = CLASS_SPACE,
+  [BEGIN_TAG_TOKEN] = CLASS_BEGIN_TAG,
+  [END_TAG_TOKEN] = CLASS_END_TAG,
+};
 
 typedef enum {
   BEGIN_OPEN_TAG = 0,
@@ -40,6 +96,9 @@ typedef enum {
   TEXT = 3,
 } XMLTokenType;
 
+#define TOKEN_TYPES (TEXT + 1)
+#define NO_TOKEN -1
+
 typedef struct XMLToken {
   XMLTokenType type;
   char* data;
@@ -57,6 +116,27 @@ typedef enum {
   STATE_ERROR
 } ParseState;
 
+// Actions run on a transition of the parser
+typedef enum {
+  ACTION_NONE = 0,
+  ACTION_PUSH_TAG,          // name of open tag
+  ACTION_END_OPEN_TAG,      // end of open tag
+  ACTION_PUSH_VALUE,        // text value, or NULL value when children follow
+  ACTION_CHECK_CLOSE_TAG,   // name of close tag must match open tag
+  ACTION_BUILD_ELEMENT,     // end of close tag
+} ParseAction;
+
+// Public sizes of XMLParseStats arrays must follow the private enums
+_Static_assert(XML_STATS_TOKEN_TYPES == TOKEN_TYPES, "XML_STATS_TOKEN_TYPES must match XMLTokenType");
+_Static_assert(XML_STATS_STATES == STATE_ERROR, "XML_STATS_STATES must match ParseState");
+
+// A transition packs next state (low 4 bits) and action (high 4 bits)
+#define TRANSITION(state, action) ((action) << 4 | (state))
+#define TRANSITION_STATE(t) ((ParseState)((t) & 0x0F))
+#define TRANSITION_ACTION(t) ((ParseAction)((t) >> 4))
+#define NO_TRANSITION TRANSITION(STATE_ERROR, ACTION_NONE)
+_Static_assert(STATE_ERROR < 16 && ACTION_BUILD_ELEMENT < 16, "transition must fit a byte");
+
 // We apply the model
 // <xml> = <open_tag> (TEXT | [<xml>]*)  <close_tag>
 // <open_tag> = BEGIN_OPEN_TAG TEXT END_TAG
@@ -64,31 +144,54 @@ typedef enum {
 //
 // Model
 // STATE1 --- (BEGIN_OPEN_TAG) ----> STATE2
-// STATE2 --- (TEXT) --------------> STATE3
-// STATE3 --- (END_TAG) -----------> STATE4
-// STATE4 --- (BEGIN_OPEN_TAG) ----> STATE2
-// STATE4 --- (TEXT) --------------> STATE5
+// STATE2 --- (TEXT) --------------> STATE3   push tag
+// STATE3 --- (END_TAG) -----------> STATE4   end open tag
+// STATE4 --- (BEGIN_OPEN_TAG) ----> STATE2   push value (NULL)
+// STATE4 --- (TEXT) --------------> STATE5   push value
 // STATE5 --- (BEGIN_CLOSE_TAG) ---> STATE6
-// STATE6 --- (TEXT) --------------> STATE7
-// STATE7 --- (END_TAG) -----------> STATE8
+// STATE6 --- (TEXT) --------------> STATE7   check close tag
+// STATE7 --- (END_TAG) -----------> STATE8   build element
 // STATE8 --- (BEGIN_OPEN_TAG) ----> STATE2
-static ParseState state_translate[8][4] = {
-  //BEGIN_OPEN_TAG  BEGIN_CLOSE_TAG   END_TAG      TEXT
-  { STATE2,         STATE_ERROR,      STATE_ERROR, STATE_ERROR }, // STATE1
-  { STATE_ERROR,    STATE_ERROR,      STATE_ERROR, STATE3 },      // STATE2
-  { STATE_ERROR,    STATE_ERROR,      STATE4,      STATE_ERROR }, // STATE3
-  { STATE2,         STATE_ERROR,      STATE_ERROR, STATE5 },      // STATE4
-  { STATE_ERROR,    STATE6,           STATE_ERROR, STATE_ERROR }, // STATE5
-  { STATE_ERROR,    STATE_ERROR,      STATE_ERROR, STATE7 },      // STATE6
-  { STATE_ERROR,    STATE_ERROR,      STATE8,      STATE_ERROR }, // STATE7
-  { STATE2,         STATE6,           STATE_ERROR, STATE_ERROR }, // STATE8
+//
+// Flattened to one lookup per token: parse_table[state * TOKEN_TYPES + type]
+// Columns are BEGIN_OPEN_TAG, BEGIN_CLOSE_TAG, END_TAG, TEXT
+static const unsigned char parse_table[STATE_ERROR * TOKEN_TYPES] = {
+  // STATE1
+  TRANSITION(STATE2, ACTION_NONE), NO_TRANSITION, NO_TRANSITION, NO_TRANSITION,
+  // STATE2
+  NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, TRANSITION(STATE3, ACTION_PUSH_TAG),
+  // STATE3
+  NO_TRANSITION, NO_TRANSITION, TRANSITION(STATE4, ACTION_END_OPEN_TAG), NO_TRANSITION,
+  // STATE4
+  TRANSITION(STATE2, ACTION_PUSH_VALUE), NO_TRANSITION, NO_TRANSITION, TRANSITION(STATE5, ACTION_PUSH_VALUE),
+  // STATE5
+  NO_TRANSITION, TRANSITION(STATE6, ACTION_NONE), NO_TRANSITION, NO_TRANSITION,
+  // STATE6
+  NO_TRANSITION, NO_TRANSITION, NO_TRANSITION, TRANSITION(STATE7, ACTION_CHECK_CLOSE_TAG),
+  // STATE7
+  NO_TRANSITION, NO_TRANSITION, TRANSITION(STATE8, ACTION_BUILD_ELEMENT), NO_TRANSITION,
+  // STATE8
+  TRANSITION(STATE2, ACTION_NONE), TRANSITION(STATE6, ACTION_NONE), NO_TRANSITION, NO_TRANSITION,
 };
 
 typedef struct XMLParser {
-  char* _input;
+  const char* _input;
+  int _length;
   int _pos;
   int _depth;
 
+  // last scanned TEXT token, points into `_input`, or into `_scratch`
+  // when comments, PIs or CDATA split the text (`_text_merged` is 1)
+  const char* _text;
+  int _text_size;
+  int _text_merged;
+  char* _scratch;
+  int _scratch_capacity;
+
+  // 1 after an unterminated comment, PI, declaration or CDATA section,
+  // scanning then stops with NO_TOKEN
+  int _error;
+
   ParseState state;
 
   Vector* value_stack;
@@ -100,7 +203,10 @@ typedef struct XMLParser {
 static XMLParser* XMLParser_create(XMLParser *p) {
   p = malloc(sizeof(XMLParser));
   p->_depth = 0;
+  p->_error = 0;
   p->state = STATE1;
+  p->_scratch = NULL;
+  p->_scratch_capacity = 0;
   p->tag_stack = vector_create(p->tag_stack);
   p->value_stack = vector_create(p->value_stack);
   p->element_stack = vector_create(p->element_stack);
@@ -112,95 +218,290 @@ static void XMLParser_release(XMLParser *p) {
   vector_release(p->element_stack);
   vector_release(p->value_stack);
   vector_release(p->tag_stack);
+  free(p->_scratch);
   free(p);
   p = NULL;
 }
 
-// Return text token from `from` position to `to` position in `input`
-// Example: input = "<name>Kien</name>"
-//     parser_get_text_token(parser, 1, 4) => 'name'
-static XMLToken* parser_get_text_token(XMLParser* parser, int from, int to) {
-  XMLToken* token;
-  int str_size;
+// Return new token of type `type` without data
+static XMLToken* parser_new_token(XMLTokenType type) {
+  XMLToken *token;
+  token = malloc(sizeof(XMLToken));
+  token->type = type;
+  token->data = NULL;
+  return token;
+}
 
-  token = malloc(sizeof(XMLToken)); 
-  token->type = TEXT;
-  
-  // trim
-  while (parser->_input[from] == ' ') from++;
-  while (parser->_input[to] == ' ') to--;
-  
+// Return 1 if input at position `pos` starts with `prefix`
+static int parser_starts_with(XMLParser *parser, int pos, const char *prefix) {
+  int size = strlen(prefix);
+  if (pos + size > parser->_length)
+    return 0;
+  return memcmp(parser->_input + pos, prefix, size) == 0;
+}
 
-  token->type = TEXT;
+// Return position of first occurrence of `terminator` at or after `pos`,
+// or -1 if `terminator` does not occur.
+// memchr is used to jump between candidates for the first character of
+// `terminator`, so long comments or CDATA sections are scanned a word
+// (or vector register) at a time instead of byte by byte.
+static int parser_find(XMLParser *parser, int pos, const char *terminator) {
+  char first = terminator[0];
+
+  while (pos < parser->_length) {
+    const char *found = memchr(parser->_input + pos, first, parser->_length - pos);
+    if (found == NULL)
+      return -1;
+    pos = found - parser->_input;
+    if (parser_starts_with(parser, pos, terminator))
+      return pos;
+    pos++;
+  }
 
-  if (to >= from) {
-    str_size = to - from + 1;
-    token->data = (char *)malloc(sizeof(char) * (str_size + 1));
-    strncpy(token->data, parser->_input + from, str_size);
-    token->data[str_size] = '\0';
+  return -1;
+}
+
+// Return position of the '>' ending a declaration (e.g. <!DOCTYPE ...>)
+// whose body starts at `pos`, or -1 if the declaration does not end.
+// An internal subset `[...]` is skipped up to its closing ']', so '>' of
+// the declarations inside it, and anything in quotes or comments, does not
+// end the declaration
+static int parser_find_declaration_end(XMLParser *parser, int pos) {
+  int in_subset = 0;
+
+  while (pos < parser->_length) {
+    char c = parser->_input[pos];
+
+    if (c == '"' || c == '\'') {
+      const char *found = memchr(parser->_input + pos + 1, c, 
+          parser->_length - pos - 1);
+      if (found == NULL)
+        return -1;
+      pos = found - parser->_input + 1;
+      continue;
+    }
+    if (in_subset && parser_starts_with(parser, pos, COMMENT_BEGIN)) {
+      pos = parser_find(parser, pos + strlen(COMMENT_BEGIN), COMMENT_END);
+      if (pos < 0)
+        return -1;
+      pos += strlen(COMMENT_END);
+      continue;
+    }
+
+    if (c == '[') {
+      in_subset = 1;
+    } else if (c == ']') {
+      in_subset = 0;
+    } else if (c == END_TAG_TOKEN && !in_subset) {
+      return pos;
+    }
+    pos++;
+  }
+
+  return -1;
+}
+
+// Skip comment, processing instruction (including the xml declaration)
+// or DOCTYPE starting at `parser->_pos`
+// If it does not end, `_error` is set and the rest of input is skipped
+// Return 1 if something was skipped, 0 otherwise
+static int parser_skip_markup(XMLParser *parser) {
+  int end;
+  const char *terminator;
+
+  if (parser_starts_with(parser, parser->_pos, COMMENT_BEGIN)) {
+    terminator = COMMENT_END;
+    end = parser_find(parser, parser->_pos + strlen(COMMENT_BEGIN), terminator);
+  } else if (parser_starts_with(parser, parser->_pos, PI_BEGIN)) {
+    terminator = PI_END;
+    end = parser_find(parser, parser->_pos + strlen(PI_BEGIN), terminator);
+  } else if (parser->_pos + 1 < parser->_length
+      && parser->_input[parser->_pos + 1] == EXCLAMATION_TOKEN
+      && !parser_starts_with(parser, parser->_pos, CDATA_BEGIN)) {
+    // <!DOCTYPE ...> and other declarations
+    terminator = ">";
+    end = parser_find_declaration_end(parser, parser->_pos + 2);
   } else {
-    token->data = NULL;
+    return 0;
   }
 
-  return token; 
+  if (end < 0) {
+    parser->_error = 1;
+    parser->_pos = parser->_length;
+    return 1;
+  }
+  parser->_pos = end + strlen(terminator);
+  return 1;
 }
 
-// Get next token of input 
-static XMLToken* parser_get_next_token(XMLParser *parser) {
-  int length, begin_pos;
- 
-  begin_pos = parser->_pos; 
-  length = strlen(parser->_input);
+// Scan CDATA section starting at `parser->_pos`
+// Set [`from`, `to`) to its content, kept verbatim (no trimming)
+// If it does not end, `_error` is set and the rest of input is skipped
+static void parser_scan_cdata(XMLParser *parser, int *from, int *to) {
+  *from = parser->_pos + strlen(CDATA_BEGIN);
+  *to = parser_find(parser, *from, CDATA_END);
+  if (*to < 0) {
+    parser->_error = 1;
+    *from = *to = parser->_pos = parser->_length;
+    return;
+  }
 
-  if (begin_pos >= length)
-    return NULL;
+  parser->_pos = *to + strlen(CDATA_END);
+}
 
-  while (parser->_pos < length) {
-    char ch;
-    ch = parser->_input[parser->_pos];
-    parser->_pos++;
-
-    switch(ch) {
-      case BEGIN_TAG_TOKEN: {
-        if (parser->_pos >  begin_pos + 1) {
-          parser->_pos--;
-          return parser_get_text_token(parser, begin_pos, parser->_pos - 1);
-        } else {
-          char next_char = parser->_input[parser->_pos];
-          if (next_char == SPLASH_TOKEN) {
-            XMLToken *token;
-            token = malloc(sizeof(XMLToken));
-            token->type = BEGIN_CLOSE_TAG;
-            parser->_pos++;
-            return token;
-          } else {
-            XMLToken *token;
-            token = malloc(sizeof(XMLToken));
-            token->type = BEGIN_OPEN_TAG;
-            return token;
-          }
-        }
+// Copy text run [`from`, `to`) of input to the scratch buffer, dropping
+// comments and PIs and unwrapping CDATA sections, then trim spaces outside
+// CDATA at both ends
+// Example: input = "<a> Tom <!-- c --><![CDATA[& Jerry ]]> </a>"
+//     => 'Tom & Jerry '
+static void parser_merge_text(XMLParser *parser, int from, int to) {
+  const char *input = parser->_input;
+  int pos, size, content_end;
+
+  if (parser->_scratch_capacity < to - from) {
+    parser->_scratch_capacity = to - from;
+    parser->_scratch = realloc(parser->_scratch, parser->_scratch_capacity);
+  }
+
+  // `content_end` is size without trailing spaces, -1 before any content
+  size = 0;
+  content_end = -1;
+  pos = from;
+  while (pos < to) {
+    unsigned char cls = char_class[(unsigned char)input[pos]];
+
+    if (cls == CLASS_BEGIN_TAG) {
+      int cdata_from, cdata_to;
+      parser->_pos = pos;
+      if (!parser_skip_markup(parser)) {
+        parser_scan_cdata(parser, &cdata_from, &cdata_to);
+        memcpy(parser->_scratch + size, input + cdata_from, cdata_to - cdata_from);
+        size += cdata_to - cdata_from;
+        content_end = size;
       }
+      pos = parser->_pos;
+      continue;
+    }
+
+    if (cls == CLASS_TEXT || content_end >= 0) {
+      parser->_scratch[size++] = input[pos];
+      if (cls == CLASS_TEXT) content_end = size;
+    }
+    pos++;
+  }
 
-      case END_TAG_TOKEN: 
-        if (parser->_pos > begin_pos + 1) {
-          parser->_pos--;
-          return parser_get_text_token(parser, begin_pos, parser->_pos - 1);
-        } else {
-          XMLToken *token;
-          token = malloc(sizeof(XMLToken));
-          token->type = END_TAG;
-          return token;
+  parser->_text = parser->_scratch;
+  parser->_text_size = content_end;
+  parser->_text_merged = 1;
+  parser->_pos = to;
+}
+
+// Scan next token of input
+// Bytes are classified through `char_class`, text is trimmed in the same
+// pass and text made only of spaces is not reported
+// Comments and PIs are skipped, also in the middle of a text, and CDATA
+// sections are part of the surrounding text; a text split this way is
+// merged into `_scratch`, otherwise nothing is allocated
+// Return type of token, or NO_TOKEN at end of input or after an error
+// (`_error` is 1)
+// For TEXT tokens the text is `_text_size` bytes at `_text`
+static int parser_scan_token(XMLParser *parser) {
+  const unsigned char *input = (const unsigned char *)parser->_input;
+  int pos = parser->_pos, length = parser->_length;
+  // text run: bytes from `run_begin` to `pos`, content is [`first`, `last_end`)
+  // `pieces` counts pieces with content between comments, PIs and CDATA
+  int run_begin = pos, first = -1, last_end = -1, pieces = 0;
+
+  while (pos < length) {
+    unsigned char cls = char_class[input[pos]];
+    int last;
+
+    if (cls == CLASS_BEGIN_TAG) {
+      unsigned char next = pos + 1 < length ? input[pos + 1] : '\0';
+      if (next == QUESTION_TOKEN || next == EXCLAMATION_TOKEN) {
+        parser->_pos = pos;
+        if (!parser_skip_markup(parser)) {
+          // CDATA is content, even when empty
+          int cdata_from;
+          parser_scan_cdata(parser, &cdata_from, &last_end);
+          if (first < 0) first = cdata_from;
+          pieces++;
         }
+        pos = parser->_pos;
+        continue;
+      }
+      if (first >= 0)
+        break;
+      if (next == SPLASH_TOKEN) {
+        parser->_pos = pos + 2;
+        return BEGIN_CLOSE_TAG;
+      }
+      parser->_pos = pos + 1;
+      return BEGIN_OPEN_TAG;
+    } else if (cls == CLASS_END_TAG) {
+      if (first >= 0)
+        break;
+      parser->_pos = pos + 1;
+      return END_TAG;
+    }
 
-      default:
+    // skip leading spaces
+    while (cls == CLASS_SPACE && ++pos < length) 
+      cls = char_class[input[pos]];
+    if (cls != CLASS_TEXT)
+      continue;
+
+    // text up to next '<' or '>', `last` is last byte which is not a space
+    if (first < 0) first = pos;
+    pieces++;
+    last = pos;
+    for (pos++; pos < length; pos++) {
+      cls = char_class[input[pos]];
+      if (cls >= CLASS_BEGIN_TAG)
         break;
+      last = cls == CLASS_TEXT ? pos : last;
     }
+    last_end = last + 1;
+  }
+
+  if (first < 0 || parser->_error) {
+    parser->_pos = pos;
+    return NO_TOKEN;
   }
-  
-  return parser_get_text_token(parser, begin_pos, parser->_pos - 1);  
+
+  if (pieces > 1) {
+    parser_merge_text(parser, run_begin, pos);
+  } else {
+    parser->_text = parser->_input + first;
+    parser->_text_size = last_end - first;
+    parser->_text_merged = 0;
+    parser->_pos = pos;
+  }
+  return TEXT;
 }
 
+// Get next token of input 
+// TEXT tokens own a copy of their text
+static XMLToken* parser_get_next_token(XMLParser *parser) {
+  XMLToken* token;
+  int type, str_size;
+
+  type = parser_scan_token(parser);
+  if (type == NO_TOKEN)
+    return NULL;
+
+  token = parser_new_token(type);
+  if (type == TEXT) {
+    STATS_TIMER_BEGIN(copy_timer);
+    str_size = parser->_text_size;
+    token->data = (char *)malloc(sizeof(char) * (str_size + 1));
+    memcpy(token->data, parser->_text, str_size);
+    token->data[str_size] = '\0';
+    STATS_TIMER_END(xml_stats.text_copy_cycles, copy_timer);
+  }
+
+  return token;
+}
 
 typedef struct StackElement {
   XMLElement *element;
@@ -217,106 +518,397 @@ static void StackElement_release(StackElement *se) {
   se = NULL;
 } 
 
-// Parse xml from text
+// Parse `length` bytes of xml from `text`
 // Return XMLElement represent for input
-XMLElement* parse_xml_from_text(char *text) {
+static XMLElement* parse_xml_from_range(const char *text, int length) {
   XMLToken *token;
   XMLParser *parser;
 
   parser = XMLParser_create(parser);
   parser->_input = text;
+  parser->_length = length;
   parser->_pos = 0;
   parser->state = STATE1;
 
+#ifdef SIMPLE_XML_STATS
+  long grows_before = vector_stats_grows, moves_before = vector_stats_moves;
+  memset(&xml_stats, 0, sizeof(xml_stats));
+#endif
+  STATS_TIMER_BEGIN(total_timer);
+
   while (1) {
-    ParseState state;
+    unsigned char transition;
 
+    STATS_TIMER_BEGIN(tokenize_timer);
     token = parser_get_next_token(parser); 
+    STATS_TIMER_END(xml_stats.tokenize_cycles, tokenize_timer);
     if (token == NULL) break;
-    if (token->type == TEXT && token->data == NULL) 
-      continue;
     
-    state = state_translate[parser->state][token->type];
-    if (state != STATE_ERROR) {
-      switch (parser->state) {
-
-        case STATE1:
-          break;
-
-        case STATE2:
-          if (token->type == TEXT) {
-            vector_push_back(parser->tag_stack, token->data);
-            parser->_depth++;
-          }
-          break;
-
-        case STATE3:
-          break;
-
-        case STATE4:
-          vector_push_back(parser->value_stack, token->data);
-          break;
+    STATS_ADD(xml_stats.tokens[token->type], 1);
+    STATS_ADD(xml_stats.transitions[parser->state][token->type], 1);
+    STATS_TIMER_BEGIN(build_timer);
+    transition = parse_table[parser->state * TOKEN_TYPES + token->type];
+    switch (TRANSITION_ACTION(transition)) {
+      case ACTION_PUSH_TAG:
+        vector_push_back(parser->tag_stack, token->data);
+        parser->_depth++;
+        STATS_MAX(xml_stats.max_depth, parser->_depth);
+        break;
 
-        case STATE5:
-          break;
+      case ACTION_PUSH_VALUE:
+        vector_push_back(parser->value_stack, token->data);
+        break;
 
-        case STATE6:
-          if (token->type == TEXT) {
-            assert(strcmp(token->data, vector_top_back(parser->tag_stack)) == 0); 
-          }
-          break;
+      case ACTION_CHECK_CLOSE_TAG:
+        assert(strcmp(token->data, vector_top_back(parser->tag_stack)) == 0); 
+        free(token->data);
+        break;
 
-        case STATE7:
-          if (token->type == END_TAG) {
-            char *current_tag, *current_value;
-            int i, length;
-            XMLElement *top;
-            XMLElement *current;
-            StackElement *se;
-
-            current_tag = vector_top_back(parser->tag_stack);
-            current_value = vector_top_back(parser->value_stack);
-            length = vector_size(parser->element_stack);
-            parser->_depth--;
-
-            current = XMLElement_create(current, current_tag, current_value);
-            se = StackElement_create(se);
-            se->element = current;
-            se->depth = parser->_depth;
-            
-            // find children of current elem
-            for (i = 0; i < length; ++i) {
-              StackElement *elem = (StackElement *)vector_top_back(parser->element_stack);
-              if (elem->depth <= se->depth) break;
-
-              vector_push_front(current->children, elem->element);
-              vector_pop_back(parser->element_stack);
-            }
-            
-            // push to stack
-            vector_push_back(parser->element_stack, se);
-
-            vector_pop_back(parser->tag_stack);
-            vector_pop_back(parser->value_stack);
-          }
-          break;
+      case ACTION_BUILD_ELEMENT: {
+        char *current_tag, *current_value;
+        int i, length;
+        XMLElement *current;
+        StackElement *se;
+
+        current_tag = vector_top_back(parser->tag_stack);
+        current_value = vector_top_back(parser->value_stack);
+        length = vector_size(parser->element_stack);
+        parser->_depth--;
+
+        STATS_TIMER_BEGIN(alloc_timer);
+        current = XMLElement_create(current, current_tag, current_value);
+        se = StackElement_create(se);
+        STATS_TIMER_END(xml_stats.alloc_cycles, alloc_timer);
+        se->element = current;
+        se->depth = parser->_depth;
+        
+        // find children of current elem
+        for (i = 0; i < length; ++i) {
+          StackElement *elem = (StackElement *)vector_top_back(parser->element_stack);
+          if (elem->depth <= se->depth) break;
+
+          vector_push_front(current->children, elem->element);
+          vector_pop_back(parser->element_stack);
+        }
+        STATS_MAX(xml_stats.max_fanout, vector_size(current->children));
+        
+        // push to stack
+        vector_push_back(parser->element_stack, se);
 
-        case STATE8:
-          break;
-        default:
-          break;
+        vector_pop_back(parser->tag_stack);
+        vector_pop_back(parser->value_stack);
+        break;
       }
+
+      default:
+        break;
     }
+    STATS_TIMER_END(xml_stats.tree_build_cycles, build_timer);
 
     free(token);
-    if (state == STATE_ERROR)
-      assert(state != STATE_ERROR && "error while parsing");
-    parser->state = state; 
+    assert(TRANSITION_STATE(transition) != STATE_ERROR && "error while parsing");
+    parser->state = TRANSITION_STATE(transition); 
   } 
 
+  assert(!parser->_error && "unterminated markup");
   StackElement* stackElem = (StackElement *) vector_top_back(parser->element_stack);
+  assert(stackElem != NULL && "no element in input");
   XMLElement *xmlElem = stackElem->element;
   StackElement_release(stackElem);
   XMLParser_release(parser);
+
+  STATS_TIMER_END(xml_stats.total_cycles, total_timer);
+#ifdef SIMPLE_XML_STATS
+  xml_stats.tokenize_cycles -= xml_stats.text_copy_cycles;
+  xml_stats.tree_build_cycles -= xml_stats.alloc_cycles;
+  xml_stats.vector_grows = vector_stats_grows - grows_before;
+  xml_stats.vector_moves = vector_stats_moves - moves_before;
+#endif
   return xmlElem;
 }
+
+// Return 1 if some binding is `path` or inside `path`
+static int bind_path_is_bound(const XMLBinding *bindings, int binding_count, 
+    const char *path, int path_length) {
+  int i;
+  for (i = 0; i < binding_count; ++i) {
+    const char *p = bindings[i].path;
+    if (strncmp(p, path, path_length) == 0 
+        && (p[path_length] == '\0' || p[path_length] == SPLASH_TOKEN))
+      return 1;
+  }
+  return 0;
+}
+
+// Return binding of `path`, or NULL if `path` is not bound
+static const XMLBinding* bind_find(const XMLBinding *bindings, int binding_count, 
+    const char *path, int path_length) {
+  int i;
+  for (i = 0; i < binding_count; ++i) {
+    const char *p = bindings[i].path;
+    if (strncmp(p, path, path_length) == 0 && p[path_length] == '\0')
+      return &bindings[i];
+  }
+  return NULL;
+}
+
+// Convert `size` bytes of `text` and store it to field of `binding`
+// `merged` text is not part of the input (see parser_merge_text), so it
+// cannot be kept as a string slice
+// Return 1 if sucessfull, 0 if text cannot be converted
+static int bind_store(const XMLBinding *binding, void *target, 
+    const char *text, int size, int merged) {
+  char number[64], *end;
+  char *field = (char *)target + binding->offset;
+
+  if (binding->type == XML_BIND_STRING && merged)
+    return 0;
+
+  if (binding->max_count > 0) {
+    int *count = (int *)((char *)target + binding->count_offset);
+    if (*count >= binding->max_count)
+      return 1;
+    switch (binding->type) {
+      case XML_BIND_INT: field += *count * sizeof(int); break;
+      case XML_BIND_DOUBLE: field += *count * sizeof(double); break;
+      case XML_BIND_STRING: field += *count * sizeof(XMLStringSlice); break;
+    }
+    (*count)++;
+  }
+
+  if (binding->type == XML_BIND_STRING) {
+    XMLStringSlice *slice = (XMLStringSlice *)field;
+    slice->data = text;
+    slice->length = size;
+    return 1;
+  }
+
+  // numbers are converted from a NUL terminated copy
+  if (size <= 0 || size >= (int)sizeof(number))
+    return 0;
+  memcpy(number, text, size);
+  number[size] = '\0';
+  if (binding->type == XML_BIND_INT) {
+    long value = strtol(number, &end, 10);
+    if ((int)value != value) return 0;
+    *(int *)field = value;
+  } else {
+    *(double *)field = strtod(number, &end);
+  }
+  return *end == '\0';
+}
+
+// Skip rest of element `name` whose open tag was just scanned, including
+// its close tag. Names of open elements are kept as ranges of the input,
+// every close tag must match the innermost one
+// Return 1 if sucessfull
+//        0 if input ends before close tag, a close tag does not match, 
+//        a tag name contains markup or elements nest too deep
+static int parser_skip_element(XMLParser *parser, const char *name, int size) {
+  const char *names[XML_BIND_MAX_SKIP_DEPTH];
+  int sizes[XML_BIND_MAX_SKIP_DEPTH];
+  int depth = 1, type, last = NO_TOKEN;
+
+  names[0] = name;
+  sizes[0] = size;
+  while ((type = parser_scan_token(parser)) != NO_TOKEN) {
+    if (last == BEGIN_OPEN_TAG || last == BEGIN_CLOSE_TAG) {
+      // tag name, a merged name is not a range of the input
+      if (type != TEXT || parser->_text_merged)
+        return 0;
+      if (last == BEGIN_OPEN_TAG) {
+        if (depth == XML_BIND_MAX_SKIP_DEPTH)
+          return 0;
+        names[depth] = parser->_text;
+        sizes[depth] = parser->_text_size;
+        depth++;
+      } else {
+        depth--;
+        if (sizes[depth] != parser->_text_size 
+            || memcmp(names[depth], parser->_text, sizes[depth]) != 0)
+          return 0;
+      }
+    } else if (type == END_TAG && depth == 0) {
+      return 1;
+    }
+    last = type;
+  }
+  return 0;
+}
+
+// Drive `parser` over its input, storing bound values to `target`
+// Return 1 if sucessfull, 0 otherwise
+static int bind_run(XMLParser *parser, const XMLBinding *bindings, 
+    int binding_count, void *target) {
+  char path[XML_BIND_MAX_PATH];
+  const char *tag = NULL;
+  int type, path_length, skip_depth, tag_size = 0;
+
+  path_length = 0;
+  // depth of an element whose name does not fit `path`
+  skip_depth = 0;
+
+  while ((type = parser_scan_token(parser)) != NO_TOKEN) {
+    unsigned char transition;
+    ParseState state;
+    int size;
+
+    transition = parse_table[parser->state * TOKEN_TYPES + type];
+    state = TRANSITION_STATE(transition);
+    if (state == STATE_ERROR)
+      return 0;
+    size = parser->_text_size;
+
+    switch (TRANSITION_ACTION(transition)) {
+      case ACTION_PUSH_TAG:
+        // open tag name, append to path
+        parser->_depth++;
+        if (path_length + size + 1 >= XML_BIND_MAX_PATH) {
+          // name is only needed if the element is skipped, keep it when it
+          // is a range of the input
+          skip_depth = parser->_depth;
+          tag = parser->_text_merged ? NULL : parser->_text;
+          tag_size = size;
+          break;
+        }
+        if (path_length > 0) 
+          path[path_length++] = SPLASH_TOKEN;
+        memcpy(path + path_length, parser->_text, size);
+        tag = path + path_length;
+        tag_size = size;
+        path_length += size;
+        break;
+
+      case ACTION_END_OPEN_TAG:
+        // end of open tag, skip subtree nobody is bound to
+        if (skip_depth == parser->_depth 
+            || !bind_path_is_bound(bindings, binding_count, path, path_length)) {
+          if (tag == NULL || !parser_skip_element(parser, tag, tag_size))
+            return 0;
+          state = STATE8;
+          if (skip_depth != parser->_depth) {
+            while (path_length > 0 && path[path_length - 1] != SPLASH_TOKEN) path_length--;
+            if (path_length > 0) path_length--;
+          }
+          skip_depth = 0;
+          parser->_depth--;
+        }
+        break;
+
+      case ACTION_PUSH_VALUE:
+        if (type == TEXT) {
+          const XMLBinding *binding = bind_find(bindings, binding_count, path, path_length);
+          if (binding != NULL && !bind_store(binding, target, 
+                parser->_text, parser->_text_size, parser->_text_merged))
+            return 0;
+        }
+        break;
+
+      case ACTION_CHECK_CLOSE_TAG: {
+        // close tag name must match last path component
+        int last = path_length;
+        while (last > 0 && path[last - 1] != SPLASH_TOKEN) last--;
+        if (path_length - last != size 
+            || memcmp(path + last, parser->_text, size) != 0)
+          return 0;
+        path_length = last > 0 ? last - 1 : 0;
+        parser->_depth--;
+        break;
+      }
+
+      default:
+        break;
+    }
+
+    parser->state = state;
+  }
+
+  return !parser->_error && parser->state == STATE8 && parser->_depth == 0;
+}
+
+// Parse xml from text into struct `target` using `bindings`
+int xml_bind_from_text(const char *text, const XMLBinding *bindings, 
+    int binding_count, void *target) {
+  XMLParser parser;
+  int i, result;
+
+  for (i = 0; i < binding_count; ++i) {
+    if (bindings[i].max_count > 0)
+      *(int *)((char *)target + bindings[i].count_offset) = 0;
+  }
+
+  // parser on stack, the stacks of XMLParser are not used
+  parser._input = text;
+  parser._length = strlen(text);
+  parser._pos = 0;
+  parser._depth = 0;
+  parser._error = 0;
+  parser._scratch = NULL;
+  parser._scratch_capacity = 0;
+  parser.state = STATE1;
+
+  result = bind_run(&parser, bindings, binding_count, target);
+  free(parser._scratch);
+  return result;
+}
+
+// Copy counters of the last parse on the calling thread to `stats`
+void xml_get_parse_stats(XMLParseStats *stats) {
+#ifdef SIMPLE_XML_STATS
+  *stats = xml_stats;
+#else
+  memset(stats, 0, sizeof(XMLParseStats));
+#endif
+}
+
+// Parse xml from text
+// Return XMLElement represent for input
+XMLElement* parse_xml_from_text(char *text) {
+  return parse_xml_from_range(text, strlen(text));
+}
+
+// Parse xml from `length` bytes of `data` in UTF-8 or UTF-16 (with BOM)
+// Return XMLElement represent for input
+//        NULL if input is badly encoded, `error_offset` is set to the byte
+//        offset in `data` of the first bad sequence
+XMLElement* parse_xml_from_buffer(const char *data, int length, 
+    int strict_utf8, int *error_offset) {
+  const unsigned char *bom = (const unsigned char *)data;
+  XMLElement *elem;
+  char *utf8;
+  int offset, utf8_length;
+
+  if (error_offset != NULL) *error_offset = -1;
+
+  // UTF-16 with BOM, transcoding always validates surrogate pairs
+  if (length >= 2 && ((bom[0] == 0xFE && bom[1] == 0xFF) 
+        || (bom[0] == 0xFF && bom[1] == 0xFE))) {
+    utf8 = utf16_to_utf8(data + 2, length - 2, bom[0] == 0xFE, &utf8_length, &offset);
+    if (utf8 == NULL) {
+      if (error_offset != NULL) *error_offset = offset + 2;
+      return NULL;
+    }
+    elem = parse_xml_from_range(utf8, utf8_length);
+    free(utf8);
+    return elem;
+  }
+
+  // UTF-8 BOM
+  if (length >= 3 && bom[0] == 0xEF && bom[1] == 0xBB && bom[2] == 0xBF) {
+    data += 3;
+    length -= 3;
+    offset = 3;
+  } else {
+    offset = 0;
+  }
+
+  if (strict_utf8) {
+    int bad = utf8_validate(data, length);
+    if (bad >= 0) {
+      if (error_offset != NULL) *error_offset = bad + offset;
+      return NULL;
+    }
+  }
+
+  return parse_xml_from_range(data, length);
+}
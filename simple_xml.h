@@ -1,11 +1,14 @@
 #ifndef SIMPLE_XML_H_
 #define SIMPLE_XML_H_
 
+#include <stddef.h>
+
 typedef struct XMLElement {
   char* tag_name;
   char* value;
   struct XMLElement* parent;
   struct Vector* children; 
+  int frozen;
 } XMLElement;
 
 // Initialize for XMLElement `e` with `tag_name` and `value`
@@ -18,8 +21,118 @@ XMLElement* XMLElement_create(XMLElement *e, char* tag_name, char* value);
 // Release XMLElement
 void XMLElement_release(XMLElement *e);
 
+// Freeze tree `root`, after that the tree must not be modified
+// Parent links are filled in and every element is marked `frozen`
+//
+// A frozen tree is safe to read from many threads at once: reading never
+// writes to the tree. Freeze before the tree is shared (e.g. before
+// creating the reader threads) so the writes done here are visible
+XMLElement* XMLElement_freeze(XMLElement *root);
+
 // Parse xml from text
+// The xml declaration, processing instructions, comments and DOCTYPE (with
+// its internal subset) are skipped, also in the middle of a value; content
+// of <![CDATA[...]]> sections is kept verbatim and joined with the text
+// around it
+// Return XMLElement represent for input
+XMLElement* parse_xml_from_text(char *text);
+
+// Parse xml from `length` bytes of `data`
+// Input is UTF-8, or UTF-16 when it starts with a byte order mark
+// (UTF-16 is transcoded to UTF-8 before parsing, a UTF-8 BOM is skipped)
+// If `strict_utf8` is not 0, UTF-8 input is validated before parsing
+//
 // Return XMLElement represent for input
-XMLElement* parse_xml(char *text);
+//        NULL if input is badly encoded, `error_offset` (if not NULL) is set
+//        to the byte offset in `data` of the first bad sequence, otherwise
+//        `error_offset` is set to -1
+XMLElement* parse_xml_from_buffer(const char *data, int length,
+    int strict_utf8, int *error_offset);
+
+// Binding: parse xml straight into fields of a C struct, without building
+// XMLElement trees
+//
+// Each XMLBinding maps an element path to a field of the target struct.
+// Elements whose path is not a prefix of any binding are skipped without
+// copying anything
+//
+// Example
+//    typedef struct Programmer {
+//      XMLStringSlice name;
+//      XMLStringSlice languages[16];
+//      int language_count;
+//    } Programmer;
+//
+//    XMLBinding bindings[] = {
+//      { "programmer/name", XML_BIND_STRING, offsetof(Programmer, name), 0, 0 },
+//      { "programmer/languages/language", XML_BIND_STRING, 
+//        offsetof(Programmer, languages), 16, offsetof(Programmer, language_count) },
+//    };
+//    >>> xml_bind_from_text(text, bindings, 2, &programmer)
+#define XML_BIND_MAX_PATH 256
+// Maximal nesting of elements skipped because nothing is bound to them
+#define XML_BIND_MAX_SKIP_DEPTH 64
+
+typedef enum {
+  XML_BIND_INT = 0,       // int
+  XML_BIND_DOUBLE,        // double
+  XML_BIND_STRING,        // XMLStringSlice
+} XMLBindType;
+
+// Text in the input, not NUL terminated, valid as long as the input is
+// A text split by comments, PIs or CDATA is not one range of the input and
+// cannot be bound as a string (xml_bind_from_text returns 0)
+typedef struct XMLStringSlice {
+  const char* data;
+  int length;
+} XMLStringSlice;
+
+typedef struct XMLBinding {
+  const char* path;       // tag names separated by '/', starting at root
+  XMLBindType type;
+  size_t offset;          // offset of field in target struct
+  int max_count;          // 0 for a single field, otherwise the field is an
+                          // array of `max_count` items, later items are ignored
+  size_t count_offset;    // for arrays: offset of int field receiving the
+                          // number of items
+} XMLBinding;
+
+// Parse xml from text into struct `target` using `bindings`
+// Fields of elements missing from text are left untouched, count fields
+// of arrays are reset to 0 first
+//
+// Close tags must match their open tags, also in skipped elements
+//
+// Return 1 if parse sucessfull
+//        0 if text is not valid xml or a value cannot be converted
+int xml_bind_from_text(const char *text, const XMLBinding *bindings, 
+    int binding_count, void *target);
+
+// Counters of the last parse on the calling thread
+// Only collected when the library is built with -DSIMPLE_XML_STATS,
+// otherwise the instrumentation compiles to nothing and all counters are 0
+//
+// Cycles are exclusive: tokenize excludes text copy, tree build excludes
+// allocation of elements
+#define XML_STATS_TOKEN_TYPES 4   // BEGIN_OPEN_TAG, BEGIN_CLOSE_TAG, END_TAG, TEXT
+#define XML_STATS_STATES 8
+
+typedef struct XMLParseStats {
+  unsigned long long total_cycles;
+  unsigned long long tokenize_cycles;
+  unsigned long long text_copy_cycles;
+  unsigned long long tree_build_cycles;
+  unsigned long long alloc_cycles;
+
+  long tokens[XML_STATS_TOKEN_TYPES];
+  long transitions[XML_STATS_STATES][XML_STATS_TOKEN_TYPES];
+  long vector_grows;
+  long vector_moves;
+  int max_depth;
+  int max_fanout;
+} XMLParseStats;
+
+// Copy counters of the last parse on the calling thread to `stats`
+void xml_get_parse_stats(XMLParseStats *stats);
 
 #endif
@@ -1,8 +1,15 @@
 #include <stdio.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <unistd.h>
 #include "simple_xml.h"
 #include "simple_vector.h"
+#include "simple_utf8.h"
+#include "simple_snapshot.h"
+#include "simple_parallel.h"
+#include "test_fixture.h"
 
 void test_vector() {
   Vector *v;
@@ -168,9 +175,382 @@ void test_xml() {
   printf("PASSED Test parser xml\n");
 }
 
+void test_xml_markup() {
+  char* s = 
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n\
+    <!DOCTYPE programmer>\n\
+    <!-- list of <programmer> -->\n\
+    <programmer>\n\
+    <?process me?>\n\
+    <name><![CDATA[ <Kien> & Nguyen ]]></name>\n\
+    <!-- a -- comment -> with > inside -->\n\
+    <languages>\n\
+    <language>C</language>\n\
+    <language><![CDATA[]]></language>\n\
+    </languages>\n\
+    </programmer>\n\
+    <!-- trailing comment -->\n";
+
+  XMLElement *elem, *child1, *child2, *child;
+  elem = parse_xml_from_text(s); 
+  assert(strcmp(elem->tag_name, "programmer") == 0);
+  assert(vector_size(elem->children) == 2);
+
+  child1 = (XMLElement *)vector_get_element_at(elem->children, 0); 
+  assert(strcmp(child1->tag_name, "name") == 0);
+  assert(strcmp(child1->value, " <Kien> & Nguyen ") == 0);
+
+  child2 = (XMLElement *)vector_get_element_at(elem->children, 1); 
+  assert(strcmp(child2->tag_name, "languages") == 0);
+  assert(vector_size(child2->children) == 2);
+  child = (XMLElement *)vector_get_element_at(child2->children, 0); 
+  assert(strcmp(child->value, "C") == 0);
+  child = (XMLElement *)vector_get_element_at(child2->children, 1); 
+  assert(strcmp(child->value, "") == 0);
+
+  // comments, PIs and CDATA inside a text are part of one value
+  elem = parse_xml_from_text("<a>foo<!-- c -->bar</a>");
+  assert(strcmp(elem->value, "foobar") == 0);
+  elem = parse_xml_from_text("<a>Tom <![CDATA[& Jerry]]></a>");
+  assert(strcmp(elem->value, "Tom & Jerry") == 0);
+  elem = parse_xml_from_text("<a>\n  <!-- c --> Tom <?pi?> and <![CDATA[ Jerry ]]>  \n</a>");
+  assert(strcmp(elem->value, "Tom  and  Jerry ") == 0);
+
+  // DOCTYPE with an internal subset
+  elem = parse_xml_from_text("<!DOCTYPE r [ <!ENTITY a \"b>\"> <!-- ] > --> ]><r>1</r>");
+  assert(strcmp(elem->tag_name, "r") == 0 && strcmp(elem->value, "1") == 0);
+
+  printf("PASSED Test parser xml markup\n");
+}
+
+void test_utf8() {
+  char *s;
+  int offset;
+  XMLElement *elem;
+
+  // validator
+  assert(utf8_validate("Kien Nguyen Trung", 17) == -1);
+  assert(utf8_validate("Nguy\xE1\xBB\x85n", 8) == -1);         // U+1EC5
+  assert(utf8_validate("\xF0\x9F\x98\x80", 4) == -1);          // U+1F600
+  assert(utf8_validate("Ki\xC0\xAFn", 5) == 2);                  // overlong
+  assert(utf8_validate("\xED\xA0\x80", 3) == 0);                // surrogate
+  assert(utf8_validate("\xF4\x90\x80\x80", 4) == 0);           // > U+10FFFF
+  assert(utf8_validate("0123456789abcdef0123\xE1\xBB", 22) == 20); // truncated
+  assert(utf8_validate("0123456789abcdef0123456789\x80", 27) == 26);
+
+  // strict parsing reports offset of first bad sequence
+  s = "<name>Nguy\xE1\xBB\x85n</name>";
+  elem = parse_xml_from_buffer(s, strlen(s), 1, &offset);
+  assert(elem != NULL && offset == -1);
+  assert(strcmp(elem->value, "Nguy\xE1\xBB\x85n") == 0);
+  XMLElement_release(elem);
+
+  s = "\xEF\xBB\xBF<name>Ki\xFFn</name>";
+  assert(parse_xml_from_buffer(s, strlen(s), 1, &offset) == NULL);
+  assert(offset == 11);
+  elem = parse_xml_from_buffer(s, strlen(s), 0, &offset);
+  assert(elem != NULL && strcmp(elem->value, "Ki\xFFn") == 0);
+  XMLElement_release(elem);
+
+  // UTF-16 little endian and big endian
+  char le[] = "\xFF\xFE<\0a\0>\0\xC5\x1E=\xD8\x00\xDE<\0/\0a\0>\0";
+  elem = parse_xml_from_buffer(le, sizeof(le) - 1, 1, &offset);
+  assert(elem != NULL && offset == -1);
+  assert(strcmp(elem->tag_name, "a") == 0);
+  assert(strcmp(elem->value, "\xE1\xBB\x85\xF0\x9F\x98\x80") == 0);
+  XMLElement_release(elem);
+
+  // U+0000 would cut the document short
+  char nul[] = "\xFF\xFE<\0a\0>\0x\0\0\0<\0/\0a\0>\0";
+  assert(parse_xml_from_buffer(nul, sizeof(nul) - 1, 0, &offset) == NULL);
+  assert(offset == 10);
+  assert(utf8_validate("0123456789abcdef\0", 17) == 16);
+  assert(parse_xml_from_buffer("<a>x\0y</a>", 10, 1, &offset) == NULL);
+  assert(offset == 4);
+
+  char be[] = "\xFE\xFF\0<\0a\0>\0x\xDC\x00\0<\0/\0a\0>";
+  assert(parse_xml_from_buffer(be, sizeof(be) - 1, 1, &offset) == NULL);
+  assert(offset == 10);
+
+  printf("PASSED Test utf8\n");
+}
+
+#define SNAPSHOT_PATH "test_snapshot.bin"
+void test_snapshot() {
+  int i, root, languages;
+  char* list_languages[PROGRAMMER_LANGUAGES] = {
+    "C", "C++", "Python", "Ruby", "Objective C", "Java", "Javascript", "Lua", "C#", "PHP"
+  };
+  XMLElement *elem;
+  XMLSnapshot *snapshot;
+  FILE *f;
+
+  elem = parse_xml_from_text(programmer_xml); 
+  assert(xml_snapshot_write(elem, SNAPSHOT_PATH) == 1);
+  XMLElement_release(elem);
+
+  snapshot = xml_snapshot_open(SNAPSHOT_PATH);
+  assert(snapshot != NULL);
+  assert(xml_snapshot_verify(snapshot) == 1);
+  assert(xml_snapshot_size(snapshot) == 3 + PROGRAMMER_LANGUAGES);
+
+  root = 0;
+  assert(strcmp(xml_snapshot_tag_name(snapshot, root), "programmer") == 0);
+  assert(xml_snapshot_parent(snapshot, root) == -1);
+  assert(xml_snapshot_child_count(snapshot, root) == 2);
+  assert(strcmp(xml_snapshot_value(snapshot, xml_snapshot_child_at(snapshot, root, 0)), 
+        "Kien Nguyen Trung") == 0);
+
+  languages = xml_snapshot_child_at(snapshot, root, 1);
+  assert(strcmp(xml_snapshot_tag_name(snapshot, languages), "languages") == 0);
+  assert(xml_snapshot_value(snapshot, languages) == NULL);
+  assert(xml_snapshot_child_count(snapshot, languages) == PROGRAMMER_LANGUAGES);
+  for (i = 0; i < PROGRAMMER_LANGUAGES; ++i) {
+    int child = xml_snapshot_child_at(snapshot, languages, i);
+    assert(xml_snapshot_parent(snapshot, child) == languages);
+    assert(strcmp(xml_snapshot_tag_name(snapshot, child), "language") == 0);
+    assert(strcmp(xml_snapshot_value(snapshot, child), list_languages[i]) == 0);
+  }
+  xml_snapshot_close(snapshot);
+
+  // repeated strings are stored once
+  elem = parse_xml_from_text("<languages>\
+    <language>C</language>\
+    <language>C++</language>\
+    <language>C</language>\
+    </languages>");
+  assert(xml_snapshot_write(elem, SNAPSHOT_PATH) == 1);
+  XMLElement_release(elem);
+  snapshot = xml_snapshot_open(SNAPSHOT_PATH);
+  assert(snapshot != NULL);
+  assert(xml_snapshot_value(snapshot, xml_snapshot_child_at(snapshot, 0, 0)) 
+      == xml_snapshot_value(snapshot, xml_snapshot_child_at(snapshot, 0, 2)));
+  assert(xml_snapshot_value(snapshot, xml_snapshot_child_at(snapshot, 0, 0)) 
+      != xml_snapshot_value(snapshot, xml_snapshot_child_at(snapshot, 0, 1)));
+  xml_snapshot_close(snapshot);
+
+  // corrupted snapshot opens, but is rejected by checksum
+  f = fopen(SNAPSHOT_PATH, "r+b");
+  fseek(f, -2, SEEK_END);
+  fputc('X', f);
+  fclose(f);
+  snapshot = xml_snapshot_open(SNAPSHOT_PATH);
+  assert(snapshot != NULL);
+  assert(xml_snapshot_verify(snapshot) == 0);
+  xml_snapshot_close(snapshot);
+
+  // truncated snapshot does not open
+  assert(truncate(SNAPSHOT_PATH, sizeof(XMLSnapshotHeader) + 4) == 0);
+  assert(xml_snapshot_open(SNAPSHOT_PATH) == NULL);
+  remove(SNAPSHOT_PATH);
+  assert(xml_snapshot_open(SNAPSHOT_PATH) == NULL);
+
+  printf("PASSED Test snapshot\n");
+}
+
+typedef struct ParallelCounter {
+  int elements;
+  int languages;
+} ParallelCounter;
+
+static void count_languages(XMLElement *e, void *arg) {
+  ParallelCounter *counter = arg;
+  __atomic_fetch_add(&counter->elements, 1, __ATOMIC_RELAXED);
+  if (strcmp(e->tag_name, "language") == 0) {
+    assert(e->parent != NULL && strcmp(e->parent->tag_name, "languages") == 0);
+    __atomic_fetch_add(&counter->languages, 1, __ATOMIC_RELAXED);
+  }
+}
+
+#define PROGRAMMERS 500
+#define CALLERS 4
+
+typedef struct ParallelCaller {
+  XMLElement *root;
+  XMLThreadPool *pool;
+} ParallelCaller;
+
+// Many request threads querying one frozen tree through one pool
+static void* parallel_caller(void *data) {
+  ParallelCaller *caller = data;
+  int i;
+
+  for (i = 0; i < 10; ++i) {
+    ParallelCounter counter = { 0, 0 };
+    xml_parallel_for_each(caller->root, count_languages, &counter, caller->pool);
+    assert(counter.elements == 1 + PROGRAMMERS * 6);
+    assert(counter.languages == PROGRAMMERS * 3);
+  }
+  return NULL;
+}
+
+void test_parallel() {
+  int i, threads;
+  char *s, *pos;
+  XMLElement *elem;
+  XMLThreadPool *pool;
+  pthread_t callers[CALLERS];
+  ParallelCaller caller;
+
+  // <programmers> with PROGRAMMERS * (name, languages, 3 * language)
+  s = malloc(PROGRAMMERS * 200 + 100);
+  pos = s + sprintf(s, "<programmers>");
+  for (i = 0; i < PROGRAMMERS; ++i) {
+    pos += sprintf(pos, "<programmer><name>P%d</name><languages>"
+        "<language>C</language><language>Lua</language><language>C#</language>"
+        "</languages></programmer>", i);
+  }
+  sprintf(pos, "</programmers>");
+
+  elem = XMLElement_freeze(parse_xml_from_text(s));
+  assert(elem->frozen && elem->parent == NULL);
+
+  // no pool: everything on calling thread
+  {
+    ParallelCounter counter = { 0, 0 };
+    xml_parallel_for_each(elem, count_languages, &counter, NULL);
+    assert(counter.elements == 1 + PROGRAMMERS * 6);
+    assert(counter.languages == PROGRAMMERS * 3);
+  }
+
+  for (threads = 1; threads <= 8; threads *= 2) {
+    pool = XMLThreadPool_create(pool, threads);
+    caller.root = elem;
+    caller.pool = pool;
+    parallel_caller(&caller);
+
+    // concurrent callers share the pool
+    for (i = 0; i < CALLERS; ++i)
+      assert(pthread_create(&callers[i], NULL, parallel_caller, &caller) == 0);
+    for (i = 0; i < CALLERS; ++i)
+      pthread_join(callers[i], NULL);
+    XMLThreadPool_release(pool);
+  }
+  free(s);
+
+  printf("PASSED Test parallel\n");
+}
+
+void test_parse_stats() {
+  int i, j;
+  long transitions;
+  XMLParseStats stats;
+
+  parse_xml_from_text(programmer_xml);
+  xml_get_parse_stats(&stats);
+
+#ifdef SIMPLE_XML_STATS
+  // 13 elements, 11 values
+  assert(stats.tokens[0] == 13);          // BEGIN_OPEN_TAG
+  assert(stats.tokens[1] == 13);          // BEGIN_CLOSE_TAG
+  assert(stats.tokens[2] == 26);          // END_TAG
+  assert(stats.tokens[3] == 26 + 11);     // TEXT
+  assert(stats.transitions[0][0] == 1);   // root open tag
+  assert(stats.transitions[3][3] == 11);  // values
+  transitions = 0;
+  for (i = 0; i < XML_STATS_STATES; ++i)
+    for (j = 0; j < XML_STATS_TOKEN_TYPES; ++j)
+      transitions += stats.transitions[i][j];
+  assert(transitions == 13 + 13 + 26 + 37);
+  assert(stats.max_depth == 3);
+  assert(stats.max_fanout == 10);
+  assert(stats.vector_grows >= 1);        // 10 languages > initial capacity
+  assert(stats.total_cycles > 0);
+  assert(stats.tokenize_cycles + stats.text_copy_cycles 
+      + stats.tree_build_cycles + stats.alloc_cycles <= stats.total_cycles);
+  printf("PASSED Test parse stats (enabled)\n");
+#else
+  transitions = 0;
+  for (i = 0; i < XML_STATS_STATES; ++i)
+    for (j = 0; j < XML_STATS_TOKEN_TYPES; ++j)
+      transitions += stats.transitions[i][j];
+  assert(transitions == 0 && stats.max_depth == 0 && stats.total_cycles == 0);
+  printf("PASSED Test parse stats (disabled)\n");
+#endif
+}
+
+typedef struct BindProgrammer {
+  XMLStringSlice name;
+  int age;
+  double rating;
+  XMLStringSlice languages[4];
+  int language_count;
+  int years[4];
+  int year_count;
+} BindProgrammer;
+
+void test_bind() {
+  int i;
+  BindProgrammer p;
+  char* s = 
+    "<?xml version=\"1.0\"?>\
+    <programmer>\
+    <name>Kien Nguyen Trung</name>\
+    <age> 30 </age>\
+    <projects><project><name>SimpleXML</name></project></projects>\
+    <rating>4.5</rating>\
+    <languages>\
+    <language>C</language>\
+    <!-- skipped -->\
+    <language><![CDATA[C++]]></language>\
+    <language>Python</language>\
+    <language>Ruby</language>\
+    <language>Lua</language>\
+    </languages> \
+    <years><year>2010</year><year>2012</year></years>\
+    </programmer>";
+  char* list_languages[4] = { "C", "C++", "Python", "Ruby" };
+  XMLBinding bindings[] = {
+    { "programmer/name", XML_BIND_STRING, offsetof(BindProgrammer, name), 0, 0 },
+    { "programmer/age", XML_BIND_INT, offsetof(BindProgrammer, age), 0, 0 },
+    { "programmer/rating", XML_BIND_DOUBLE, offsetof(BindProgrammer, rating), 0, 0 },
+    { "programmer/languages/language", XML_BIND_STRING, 
+      offsetof(BindProgrammer, languages), 4, offsetof(BindProgrammer, language_count) },
+    { "programmer/years/year", XML_BIND_INT, 
+      offsetof(BindProgrammer, years), 4, offsetof(BindProgrammer, year_count) },
+  };
+
+  assert(xml_bind_from_text(s, bindings, 5, &p) == 1);
+  assert(p.name.length == 17 && strncmp(p.name.data, "Kien Nguyen Trung", 17) == 0);
+  assert(p.age == 30);
+  assert(p.rating == 4.5);
+  assert(p.language_count == 4);      // 5th language is ignored
+  for (i = 0; i < 4; ++i) {
+    assert(p.languages[i].length == (int)strlen(list_languages[i]));
+    assert(strncmp(p.languages[i].data, list_languages[i], p.languages[i].length) == 0);
+  }
+  assert(p.year_count == 2 && p.years[0] == 2010 && p.years[1] == 2012);
+
+  // errors
+  assert(xml_bind_from_text("<programmer><age>thirty</age></programmer>", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<programmer><age>30</name></programmer>", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<programmer><other>1</other>", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<programmer><other>1</other></programmer>", bindings, 5, &p) == 1);
+  assert(xml_bind_from_text("<r><y></q></r>", bindings, 5, &p) == 0);
+  // unterminated markup is invalid xml, also in a skipped element
+  assert(xml_bind_from_text("<r><!-- x", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<r><age><![CDATA[1", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<r><x><!-- ", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<programmer></programmer><!-- x", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<programmer><age><![CDATA[1", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<programmer><x><y>1</y></x></programmer>", bindings, 5, &p) == 1);
+  assert(xml_bind_from_text("<programmer><x><y>1</x></y></programmer>", bindings, 5, &p) == 0);
+  assert(xml_bind_from_text("<programmer><age>3<!-- c -->0</age></programmer>", bindings, 5, &p) == 1);
+  assert(p.age == 30);
+  assert(xml_bind_from_text("<programmer><name>Kien <![CDATA[&]]></name></programmer>", bindings, 5, &p) == 0);
+
+  printf("PASSED Test bind\n");
+}
+
 int main(int argc, char** argv) {
   test_vector();
   test_vector2();
   test_xml();
+  test_xml_markup();
+  test_utf8();
+  test_snapshot();
+  test_parallel();
+  test_parse_stats();
+  test_bind();
   return 0;
 }
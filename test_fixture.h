@@ -0,0 +1,25 @@
+#ifndef TEST_FIXTURE_H_
+#define TEST_FIXTURE_H_
+
+// Document shared by tests and benchmarks
+static char programmer_xml[] = 
+  "<programmer>\
+  <name>Kien Nguyen Trung</name>\
+  <languages>\
+  <language>C</language>\
+  <language>C++</language>\
+  <language>Python</language>\
+  <language>Ruby</language>\
+  <language>Objective C</language>\
+  <language>Java</language>\
+  <language>Javascript</language>\
+  <language>Lua</language>\
+  <language>C#</language>\
+  <language>PHP</language>\
+  </languages> \
+  </programmer>";
+
+// Number of <language> elements in `programmer_xml`
+#define PROGRAMMER_LANGUAGES 10
+
+#endif